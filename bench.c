@@ -0,0 +1,157 @@
+/* See LICENSE file for copyright and license details. */
+#define _POSIX_C_SOURCE 200809L
+#include <getopt.h>
+#include <locale.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "drwl.h"
+
+#define WIDTH 4096
+
+static const char usage[] =
+	"usage: bench [-f font] [-n passes] < text\n";
+
+static uint32_t scheme[2] = {
+	[ColFg] = 0xbbbbbbff,
+	[ColBg] = 0x000000ff,
+};
+
+static uint64_t
+nsecs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void
+report(const char *what, uint64_t ns, size_t glyphs)
+{
+	printf("%-16s %8.1f ns/glyph\n", what, (double)ns / glyphs);
+}
+
+int
+main(int argc, char *argv[])
+{
+	const char *font_name = "monospace:size=12:dpi=96";
+	char **lines = NULL, *line = NULL;
+	size_t nlines = 0, n = 0, ncps = 0, glyphs, i;
+	uint32_t *cps = NULL, *p, cp = 0, last, state;
+	uint32_t *bits;
+	long passes = 1000, pass, x;
+	uint64_t start;
+	ssize_t len;
+	Drwl *drw;
+	int opt;
+
+	setlocale(LC_CTYPE, "");
+
+	while ((opt = getopt(argc, argv, "f:n:")) != -1) {
+		switch (opt) {
+		case 'f': font_name = optarg; break;
+		case 'n': passes = atol(optarg); break;
+		default:
+			fprintf(stderr, usage);
+			return EXIT_FAILURE;
+		}
+	}
+
+	while ((len = getline(&line, &n, stdin)) > 0) {
+		if (line[len - 1] == '\n')
+			line[--len] = '\0';
+		if (!(lines = realloc(lines, (nlines + 1) * sizeof(*lines))) ||
+		    !(lines[nlines++] = strdup(line))) {
+			perror("realloc");
+			return EXIT_FAILURE;
+		}
+
+		/* Codepoints of each line, ended by 0, decoded like drwl_text */
+		if (!(cps = realloc(cps, (ncps + len + 1) * sizeof(*cps)))) {
+			perror("realloc");
+			return EXIT_FAILURE;
+		}
+		for (const char *s = line, *ss; ss = s, *s; s++) {
+			for (state = UTF8_ACCEPT; *s &&
+			     utf8decode(&state, &cp, *s) > UTF8_REJECT; s++)
+				;
+			if (!*s || state == UTF8_REJECT) {
+				cp = UTF8_INVALID;
+				if (s > ss)
+					s--;
+			}
+			cps[ncps++] = cp;
+		}
+		cps[ncps++] = 0;
+	}
+	free(line);
+	if (passes < 1 || !(glyphs = (ncps - nlines) * passes)) {
+		fprintf(stderr, usage);
+		return EXIT_FAILURE;
+	}
+
+	drwl_init();
+	if (!(drw = drwl_create()) ||
+	    !drwl_font_create(drw, 1, &font_name, NULL)) {
+		fputs("failed to load font\n", stderr);
+		return EXIT_FAILURE;
+	}
+	drwl_setscheme(drw, scheme);
+	if (!(bits = calloc(WIDTH * drw->font->height, sizeof(*bits)))) {
+		perror("calloc");
+		return EXIT_FAILURE;
+	}
+
+	printf("%zu lines, %zu glyphs, %ld passes, %s\n", nlines,
+		ncps - nlines, passes, drw->mono ? "monospace" : "proportional");
+
+	/* Glyph and kerning lookups as done per glyph before the cache */
+	start = nsecs();
+	for (pass = 0; pass < passes; pass++)
+		for (p = cps, last = 0; p < cps + ncps; last = *p++)
+			if (*p) {
+				fcft_rasterize_char_utf32(drw->font, *p, FCFT_SUBPIXEL_DEFAULT);
+				if (last)
+					fcft_kerning(drw->font, last, *p, &x, NULL);
+			}
+	report("fcft lookup", nsecs() - start, glyphs);
+
+	start = nsecs();
+	for (pass = 0; pass < passes; pass++)
+		for (p = cps, last = 0; p < cps + ncps; last = *p++)
+			if (*p) {
+				drwl_glyph(drw, *p, FCFT_SUBPIXEL_DEFAULT, NULL);
+				if (last)
+					drwl_kerning(drw, last, *p);
+			}
+	report("drwl lookup", nsecs() - start, glyphs);
+
+	start = nsecs();
+	for (pass = 0; pass < passes; pass++)
+		for (i = 0; i < nlines; i++)
+			drwl_font_getwidth(drw, lines[i]);
+	report("measure", nsecs() - start, glyphs);
+
+	start = nsecs();
+	for (pass = 0; pass < passes; pass++) {
+		drwl_prepare_drawing(drw, WIDTH, drw->font->height, bits,
+			drwl_stride(WIDTH));
+		for (i = 0; i < nlines; i++)
+			drwl_text(drw, 0, 0, WIDTH, drw->font->height, 0, lines[i], 0);
+		drwl_finish_drawing(drw);
+	}
+	report("draw", nsecs() - start, glyphs);
+
+	for (i = 0; i < nlines; i++)
+		free(lines[i]);
+	free(lines);
+	free(cps);
+	free(bits);
+	drwl_destroy(drw);
+	drwl_fini();
+	return EXIT_SUCCESS;
+}
@@ -16,6 +16,25 @@ static int y = 0;
 /* behavior */
 static int period = 5;
 
+/*
+ * Period used while the widget is not visible (outputs off, covered or
+ * locked); 0 suspends the command until the widget is shown again.
+ */
+static int hidden_period = 0;
+
+/*
+ * CPU time in milliseconds a single command run may use before the
+ * period is doubled, up to period_max seconds; 0 disables backoff.
+ */
+static int cpu_budget = 0;
+static int period_max = 60;
+
+/*
+ * Resident memory in KiB above which cached glyphs and unused text buffer
+ * space are released; 0 disables the budget.
+ */
+static int mem_budget = 0;
+
 /*
  * Delimeter string, encountered as a separate line in subcommand output,
  * signaling rendering buffered text and continuing with next frame.
@@ -30,6 +30,7 @@
 #pragma once
 
 #include <stdlib.h>
+#include <wchar.h>
 #include <fcft/fcft.h>
 #include <pixman-1/pixman.h>
 
@@ -37,10 +38,29 @@ enum { ColFg, ColBg }; /* colorscheme index */
 
 typedef struct fcft_font Fnt;
 
+#define DRWL_GLYPH_PAGES 256  /* pages of 256 codepoints covering the BMP */
+#define DRWL_KERN_SIZE   1024 /* kerning pair cache entries, power of two */
+
+typedef struct {
+	const struct fcft_glyph *glyph;
+	int advance;
+} DrwlGlyph;
+
+typedef struct {
+	uint32_t a, b;
+	long x;
+} DrwlKern;
+
 typedef struct {
 	pixman_image_t *pix;
 	Fnt *font;
+	int mono; /* cell advance of a fixed pitch font, 0 otherwise */
 	uint32_t *scheme;
+
+	/* glyphs of the font for one subpixel mode, and kerning pairs */
+	DrwlGlyph *glyphs[DRWL_GLYPH_PAGES];
+	DrwlKern *kern;
+	int subpixel;
 } Drwl;
 
 #define UTF8_ACCEPT 0
@@ -95,11 +115,106 @@ drwl_create(void)
 	return drwl;
 }
 
+static void
+drwl_cache_clear(Drwl *drwl)
+{
+	int i;
+
+	for (i = 0; i < DRWL_GLYPH_PAGES; i++) {
+		free(drwl->glyphs[i]);
+		drwl->glyphs[i] = NULL;
+	}
+	free(drwl->kern);
+	drwl->kern = NULL;
+}
+
+static const struct fcft_glyph *
+drwl_glyph(Drwl *drwl, uint32_t cp, int subpixel, int *advance)
+{
+	const struct fcft_glyph *glyph;
+	DrwlGlyph **page, *g;
+
+	if (subpixel != drwl->subpixel) {
+		drwl_cache_clear(drwl);
+		drwl->subpixel = subpixel;
+	}
+
+	page = cp >> 8 < DRWL_GLYPH_PAGES ? &drwl->glyphs[cp >> 8] : NULL;
+	if (page && !*page)
+		*page = calloc(256, sizeof(DrwlGlyph));
+	if (!page || !*page) {
+		if ((glyph = fcft_rasterize_char_utf32(drwl->font, cp, subpixel)) && advance)
+			*advance = glyph->advance.x;
+		return glyph;
+	}
+
+	g = &(*page)[cp & 0xFF];
+	if (!g->glyph) {
+		/* A negative advance marks a codepoint the font cannot render */
+		if (g->advance < 0)
+			return NULL;
+		if (!(g->glyph = fcft_rasterize_char_utf32(drwl->font, cp, subpixel))) {
+			g->advance = -1;
+			return NULL;
+		}
+		g->advance = g->glyph->advance.x;
+	}
+
+	if (advance)
+		*advance = g->advance;
+	return g->glyph;
+}
+
+static long
+drwl_kerning(Drwl *drwl, uint32_t a, uint32_t b)
+{
+	DrwlKern *k;
+	long x = 0;
+
+	if (!drwl->kern && !(drwl->kern = calloc(DRWL_KERN_SIZE, sizeof(DrwlKern)))) {
+		fcft_kerning(drwl->font, a, b, &x, NULL);
+		return x;
+	}
+
+	k = &drwl->kern[((a * 0x9E3779B1u) ^ b) * 0x85EBCA6Bu >> 22 & (DRWL_KERN_SIZE - 1)];
+	if (k->a != a || k->b != b) {
+		k->a = a;
+		k->b = b;
+		k->x = 0;
+		fcft_kerning(drwl->font, a, b, &k->x, NULL);
+	}
+
+	return k->x;
+}
+
+static int
+drwl_font_mono(Fnt *font)
+{
+	/* Fixed pitch if narrow and wide glyphs advance like a space */
+	static const uint32_t probe[] = { 'i', 'l', '.', 'm', 'W', '0' };
+	const struct fcft_glyph *glyph;
+	size_t i;
+
+	if (!font || font->space_advance.x <= 0)
+		return 0;
+
+	for (i = 0; i < sizeof(probe) / sizeof(probe[0]); i++) {
+		glyph = fcft_rasterize_char_utf32(font, probe[i], FCFT_SUBPIXEL_DEFAULT);
+		if (!glyph || glyph->advance.x != font->space_advance.x)
+			return 0;
+	}
+
+	return font->space_advance.x;
+}
+
 static void
 drwl_setfont(Drwl *drwl, Fnt *font)
 {
-	if (drwl)
+	if (drwl) {
+		drwl_cache_clear(drwl);
 		drwl->font = font;
+		drwl->mono = drwl_font_mono(font);
+	}
 }
 
 static Fnt *
@@ -185,13 +300,13 @@ drwl_text(Drwl *drwl,
 		int x, int y, unsigned int w, unsigned int h,
 		unsigned int lpad, const char *text, int invert)
 {
-	int ty;
+	int ty, cols, advance;
 	int render = x || y || w || h;
 	long x_kern;
 	uint32_t cp = 0, last_cp = 0, state;
 	pixman_color_t clr;
 	pixman_image_t *fg_pix = NULL;
-	int noellipsis = 0;
+	int noellipsis = 0, eg_advance = 0;
 	const struct fcft_glyph *glyph, *eg = NULL;
 	int fcft_subpixel_mode = FCFT_SUBPIXEL_DEFAULT;
 
@@ -210,11 +325,14 @@ drwl_text(Drwl *drwl,
 		w -= lpad;
 	}
 
-	if (render && (drwl->scheme[ColBg] & 0xFF) != 0xFF)
+	/* Advances do not depend on it, measure with the cached mode */
+	if (!render)
+		fcft_subpixel_mode = drwl->subpixel;
+	else if ((drwl->scheme[ColBg] & 0xFF) != 0xFF)
 		fcft_subpixel_mode = FCFT_SUBPIXEL_NONE;
 
 	if (render)
-		eg = fcft_rasterize_char_utf32(drwl->font, 0x2026 /* … */, fcft_subpixel_mode);
+		eg = drwl_glyph(drwl, 0x2026 /* … */, fcft_subpixel_mode, &eg_advance);
 
 	for (const char *p = text, *pp; pp = p, *p; p++) {
 		for (state = UTF8_ACCEPT; *p &&
@@ -226,47 +344,57 @@ drwl_text(Drwl *drwl,
 				p--;
 		}
 
-		glyph = fcft_rasterize_char_utf32(drwl->font, cp, fcft_subpixel_mode);
-		if (!glyph)
-			continue;
-
 		x_kern = 0;
-		if (last_cp)
-			fcft_kerning(drwl->font, last_cp, cp, &x_kern, NULL);
-		last_cp = cp;
+		if (drwl->mono) {
+			/* Place on the cell grid, rasterized below once it fits */
+			cols = wcwidth(cp);
+			advance = drwl->mono * (cols < 0 ? 1 : cols);
+			glyph = NULL;
+		} else {
+			glyph = drwl_glyph(drwl, cp, fcft_subpixel_mode, &advance);
+			if (!glyph)
+				continue;
+
+			if (last_cp)
+				x_kern = drwl_kerning(drwl, last_cp, cp);
+			last_cp = cp;
+		}
 
 		ty = y + (h - drwl->font->height) / 2 + drwl->font->ascent;
 
-		if (render && !noellipsis && x_kern + glyph->advance.x + eg->advance.x > w &&
+		if (render && !noellipsis && x_kern + advance + eg_advance > w &&
 		    *(p + 1) != '\0') {
 			/* cannot fit ellipsis after current codepoint */
 			if (drwl_text(drwl, 0, 0, 0, 0, 0, pp, 0) + x_kern <= w) {
 				noellipsis = 1;
 			} else {
-				w -= eg->advance.x;
+				w -= eg_advance;
 				pixman_image_composite32(
 					PIXMAN_OP_OVER, fg_pix, eg->pix, drwl->pix, 0, 0, 0, 0,
 					x + eg->x, ty - eg->y, eg->width, eg->height);
 			}
 		}
 
-		if ((x_kern + glyph->advance.x) > w)
+		if ((x_kern + advance) > w)
 			break;
 
 		x += x_kern;
 
-		if (render && pixman_image_get_format(glyph->pix) == PIXMAN_a8r8g8b8)
+		if (render && !glyph)
+			glyph = drwl_glyph(drwl, cp, fcft_subpixel_mode, NULL);
+
+		if (render && glyph && pixman_image_get_format(glyph->pix) == PIXMAN_a8r8g8b8)
 			/* pre-rendered glyphs (eg. emoji) */
 			pixman_image_composite32(
 				PIXMAN_OP_OVER, glyph->pix, NULL, drwl->pix, 0, 0, 0, 0,
 				x + glyph->x, ty - glyph->y, glyph->width, glyph->height);
-		else if (render)
+		else if (render && glyph)
 			pixman_image_composite32(
 				PIXMAN_OP_OVER, fg_pix, glyph->pix, drwl->pix, 0, 0, 0, 0,
 				x + glyph->x, ty - glyph->y, glyph->width, glyph->height);
 
-		x += glyph->advance.x;
-		w -= glyph->advance.x;
+		x += advance;
+		w -= advance;
 	}
 
 	if (render)
@@ -296,6 +424,7 @@ drwl_finish_drawing(Drwl *drwl)
 static void
 drwl_destroy(Drwl *drwl)
 {
+	drwl_cache_clear(drwl);
 	if (drwl->font)
 		drwl_font_destroy(drwl->font);
 	free(drwl);
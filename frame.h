@@ -0,0 +1,16 @@
+/* See LICENSE file for copyright and license details. */
+#pragma once
+
+/*
+ * Framed protocol, read from the command with -B and from control socket
+ * clients: each frame starts with a type and payload length, both 32-bit
+ * in network byte order. FrameText carries NUL-terminated lines;
+ * FrameLines prefixes them with a line count and the offset of each line
+ * relative to the text; FrameNoChange has no payload and keeps the
+ * current text. FrameSetLine, only accepted on the control socket,
+ * carries a line index followed by the text replacing that line.
+ */
+enum { FrameText, FrameLines, FrameNoChange, FrameSetLine }; /* frame types */
+
+#define FRAME_HEADER (2 * sizeof(uint32_t))
+#define MAX_FRAME    (16 << 20)
@@ -1,18 +1,34 @@
 /* See LICENSE file for copyright and license details. */
 #define _POSIX_C_SOURCE 200809L
+#include <arpa/inet.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <getopt.h>
+#include <locale.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
 #include <poll.h>
+#include <pthread.h>
 #include <signal.h>
+#include <stdatomic.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
 #include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 #include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 #include <wayland-client.h>
 
 #include "drwl.h"
+#include "frame.h"
 #include "poolbuf.h"
 #include "xdg-shell-protocol.h"
 #include "wlr-layer-shell-unstable-v1-protocol.h"
@@ -21,37 +37,262 @@
 #define MIN(A, B)  ((A) < (B) ? (A) : (B))
 
 #define INITIAL_CAPACITY 2
+#define FRAME_TIMEOUT    1 /* seconds without frame callback until hidden */
+#define TRIM_FRAMES      16 /* small frames in a row until buffers shrink */
+#define TRIM_MIN         4096
 
 static const char usage[] =
-	"usage: wtw [-b rrggbbaa] [-c rrggbbaa] [-f font] [-p period] [-P padding]\n"
-	"           [-w num] [-h num] [-x pos] [-y pos] command [arg ...]\n";
+	"usage: wtw [-a] [-b rrggbbaa] [-c rrggbbaa] [-f font] [-p period] [-P padding]\n"
+	"           [-s period] [-C ms] [-m KiB] [-w num] [-h num] [-x pos] [-y pos]\n"
+	"           [-r trace] [-R trace [-F]] [-B] [-S socket] [-t]\n"
+	"           [command [arg ...]]\n";
+
+/* Traces are a magic followed by records of timestamp, length and bytes */
+static const char trace_magic[8] = "wtwtrc1\n";
+
+typedef struct {
+	struct wl_output *output;
+	uint32_t name;
+	struct wl_surface *surface;
+	struct zwlr_layer_surface_v1 *layer_surface;
+	struct wl_callback *frame_callback;
+	uint64_t frame_time;
+	int32_t width, height;
+	bool configured;
+	unsigned int drawn;
+
+	/* visibility */
+	int noutputs;
+	bool entered, starved, visible, dirty;
+
+	struct wl_list link;
+} Widget;
+
+/* Bound without -a only for surface enter and leave events */
+typedef struct {
+	struct wl_output *output;
+	uint32_t name;
+	struct wl_list link;
+} Output;
+
+typedef struct {
+	char *text;
+	size_t len, cap;
+	size_t *lines;
+	size_t nlines, linecap;
+	uint64_t ns; /* when it was read, for replay latency */
+	unsigned int small;
+} Frame;
+
+typedef struct {
+	int fd;
+	char *buf;
+	size_t len, cap;
+} Client;
+
+enum { IoEof = 1, IoError = 2 }; /* I/O thread state */
 
 #include "config.h"
 
+static void render(Widget *only);
+
 static struct wl_display *display;
 static struct wl_registry *registry;
 static struct wl_shm *shm;
 static struct wl_compositor *compositor;
-static struct wl_surface *surface;
 static struct zwlr_layer_shell_v1 *layer_shell;
-static struct zwlr_layer_surface_v1 *layer_surface;
+static struct wl_list widgets;
+static struct wl_list outputs;
+static bool all_outputs = false;
 static Drwl *drw;
 
 static char **cmd;
 static pid_t cmdpid;
 static FILE *inputf;
-static char *text;
 static int signal_fd = -1;
-static size_t len;
-static size_t cap;
+static Frame frames[3];
+static Frame *frame = &frames[0];
+static bool framed = false;
+
+/* pipeline, middle holds a frames index and FRESH once published */
+#define FRESH 4
+static bool pipelined = false;
+static pthread_t io_thread;
+static int io_fd = -1;
+static int io_ctl[2] = { -1, -1 };
+static atomic_uint io_state;
+static atomic_bool io_stop;
+static atomic_uint middle = 1;
+static unsigned int back = 2;
+
+/* control socket */
+static const char *ctl_path;
+static int ctl_fd = -1;
+static Client *clients;
+static size_t nclients;
+static struct pollfd *pollfds;
+
+/* record and replay */
+static FILE *recordf;
+static FILE *replayf;
+static bool replay_fast = false;
+static uint64_t trace_start;
+static struct {
+	uint64_t start, end;
+	uint64_t frames;
+	atomic_uint_least64_t bytes;
+	uint64_t lat_min, lat_max, lat_sum;
+} stats;
 
 static bool restart = false;
 static bool running = false;
 
+/* command accounting, times in nanoseconds */
+static int cur_period;
+static struct {
+	uint64_t runs;
+	uint64_t started;
+	uint64_t cpu, wall;
+	uint64_t cpu_total, wall_total;
+	long maxrss;
+} cmdstats;
+
+static uint64_t mem_checked;
+static long mem_trimmed; /* RSS in KiB left by the last trim */
+
+/* any widget is visible */
+static bool visible = true;
+
+static uint64_t
+nsecs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void
+record(const char *data, uint32_t n)
+{
+	uint64_t ts = nsecs();
+
+	if (!trace_start)
+		trace_start = ts;
+	ts -= trace_start;
+
+	if (fwrite(&ts, sizeof(ts), 1, recordf) != 1 ||
+	    fwrite(&n, sizeof(n), 1, recordf) != 1 ||
+	    fwrite(data, 1, n, recordf) != n) {
+		perror("record");
+		fclose(recordf);
+		recordf = NULL;
+	}
+}
+
+/*
+ * Replay runs in place of the command, writing recorded chunks to the
+ * pipe with their original spacing. End of a recorded command run is
+ * turned into a delimeter so frames are split the same way.
+ */
+static int
+replay(int fd)
+{
+	FILE *out;
+	char magic[sizeof(trace_magic)], *buf = NULL;
+	size_t bufcap = 0, dlen = strlen(delimeter);
+	bool delimited = true, nl = true;
+	uint64_t ts, start = nsecs();
+	uint32_t n;
+	struct timespec until;
+
+	if (!(out = fdopen(fd, "w"))) {
+		perror("fdopen");
+		return EXIT_FAILURE;
+	}
+
+	if (fread(magic, sizeof(magic), 1, replayf) != 1 ||
+	    memcmp(magic, trace_magic, sizeof(magic)) != 0) {
+		fputs("replay: not a wtw trace\n", stderr);
+		return EXIT_FAILURE;
+	}
+
+	while (fread(&ts, sizeof(ts), 1, replayf) == 1 &&
+	       fread(&n, sizeof(n), 1, replayf) == 1) {
+		if (n > bufcap) {
+			bufcap = n;
+			if (!(buf = realloc(buf, bufcap))) {
+				perror("realloc");
+				return EXIT_FAILURE;
+			}
+		}
+		if (fread(buf, 1, n, replayf) != n)
+			break;
+
+		if (!replay_fast) {
+			fflush(out);
+			ts += start;
+			until.tv_sec = ts / 1000000000;
+			until.tv_nsec = ts % 1000000000;
+			while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME,
+			       &until, NULL) == EINTR)
+				;
+		}
+
+		if (n == 0) {
+			if (!delimited && !framed)
+				fprintf(out, "%s%s\n", nl ? "" : "\n", delimeter);
+			delimited = nl = true;
+			continue;
+		}
+
+		fwrite(buf, 1, n, out);
+		nl = buf[n - 1] == '\n';
+		delimited = n == dlen + 1 && nl && !memcmp(buf, delimeter, dlen);
+	}
+
+	free(buf);
+	return fclose(out) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static void
+replay_frame(void)
+{
+	uint64_t lat, now = nsecs();
+
+	lat = now - frame->ns;
+	if (!stats.frames++ || lat < stats.lat_min)
+		stats.lat_min = lat;
+	stats.lat_max = MAX(stats.lat_max, lat);
+	stats.lat_sum += lat;
+	stats.end = now;
+}
+
+static void
+replay_report(void)
+{
+	double secs = (stats.end - stats.start) / 1e9;
+
+	if (!stats.frames) {
+		fputs("replay: no frames\n", stderr);
+		return;
+	}
+
+	fprintf(stderr, "replay: %llu frames, %llu bytes in %.3f s "
+		"(%.1f KiB/s, %.1f frames/s)\n",
+		(unsigned long long)stats.frames, (unsigned long long)stats.bytes,
+		secs, (double)stats.bytes / 1024.0 / secs, stats.frames / secs);
+	fprintf(stderr, "replay: frame latency min %.3f ms, avg %.3f ms, max %.3f ms\n",
+		stats.lat_min / 1e6, stats.lat_sum / 1e6 / stats.frames,
+		stats.lat_max / 1e6);
+}
+
 static int
 start_cmd(void)
 {
 	int fds[2];
+	sigset_t mask;
+
 	if (pipe(fds) == -1) {
 		perror("pipe");
 		return -1;
@@ -62,6 +303,7 @@ start_cmd(void)
 		return -1;
 	}
 
+	cmdstats.started = nsecs();
 	cmdpid = fork();
 	switch (cmdpid) {
 	case -1:
@@ -69,11 +311,16 @@ start_cmd(void)
 		return 1;
 	case 0:
 		close(fds[0]);
+		/* Unblock the signals taken through signal_fd here */
+		sigemptyset(&mask);
+		sigprocmask(SIG_SETMASK, &mask, NULL);
+		if (replayf)
+			_exit(replay(fds[1]));
 		dup2(fds[1], STDOUT_FILENO);
 		setpgid(0, 0);
 		execvp(cmd[0], cmd);
 		perror("execvp");
-		exit(EXIT_FAILURE);
+		_exit(EXIT_FAILURE);
 	default:
 		break;
 	}
@@ -82,134 +329,897 @@ start_cmd(void)
 	return 0;
 }
 
+static void
+account(struct rusage *ru)
+{
+	uint64_t cpu_ms;
+
+	cmdstats.cpu = (ru->ru_utime.tv_sec + ru->ru_stime.tv_sec) * 1000000000ULL +
+		(ru->ru_utime.tv_usec + ru->ru_stime.tv_usec) * 1000ULL;
+	cmdstats.wall = nsecs() - cmdstats.started;
+	cmdstats.cpu_total += cmdstats.cpu;
+	cmdstats.wall_total += cmdstats.wall;
+	cmdstats.maxrss = MAX(cmdstats.maxrss, ru->ru_maxrss);
+	cmdstats.runs++;
+
+	/* A command run once has no period to stretch */
+	if (cpu_budget <= 0 || period == 0)
+		return;
+
+	/* Stretch the period while runs cost more than the budget */
+	cpu_ms = cmdstats.cpu / 1000000;
+	if (cpu_ms > (uint64_t)cpu_budget)
+		cur_period = MIN(MAX(cur_period * 2, 1), MAX(period_max, period));
+	else if (cpu_ms < (uint64_t)cpu_budget / 2 && cur_period > period)
+		cur_period = cur_period / 2 >= MAX(period, 1) ? cur_period / 2 : period;
+}
+
+static long
+rss(void)
+{
+	long pages;
+	FILE *f;
+
+	if (!(f = fopen("/proc/self/statm", "r")))
+		return -1;
+	if (fscanf(f, "%*s %ld", &pages) != 1)
+		pages = -1;
+	fclose(f);
+	return pages < 0 ? -1 : pages * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+static void
+print_stats(void)
+{
+	uint64_t runs = MAX(cmdstats.runs, 1);
+
+	fprintf(stderr, "wtw: %llu runs, last %.1f ms cpu %.1f ms wall, "
+		"avg %.1f ms cpu %.1f ms wall, max rss %ld KiB, period %d s\n",
+		(unsigned long long)cmdstats.runs,
+		cmdstats.cpu / 1e6, cmdstats.wall / 1e6,
+		cmdstats.cpu_total / 1e6 / runs, cmdstats.wall_total / 1e6 / runs,
+		cmdstats.maxrss, cur_period);
+	fprintf(stderr, "wtw: rss %ld KiB, budget %d KiB\n", rss(), mem_budget);
+}
+
 static void
 reap(void)
 {
 	pid_t p;
 	int status;
+	struct rusage ru;
 
 	do {
-		if ((p = waitpid(-1, &status, cmdpid == 0 ? WNOHANG : 0)) < 0) {
-			perror("waitpid");
+		if ((p = wait4(-1, &status, cmdpid == 0 ? WNOHANG : 0, &ru)) < 0) {
+			perror("wait4");
 			return;
 		}
 		if (p == cmdpid) {
 			cmdpid = 0;
+			account(&ru);
 			return;
 		}
 	} while (!WIFEXITED(status) && !WIFSIGNALED(status));
 }
 
 static int
-read_text(void)
+push_line(Frame *f, size_t off)
+{
+	if (f->nlines == f->linecap) {
+		f->linecap = f->linecap ? f->linecap * 2 : INITIAL_CAPACITY;
+		if (!(f->lines = realloc(f->lines, f->linecap * sizeof(*f->lines)))) {
+			perror("realloc");
+			return -1;
+		}
+	}
+
+	f->lines[f->nlines++] = off;
+	return 0;
+}
+
+static int
+close_input(FILE *in)
+{
+	if (recordf)
+		record(NULL, 0);
+	if (fclose(in) == -1) {
+		perror("fclose");
+		return -1;
+	}
+	return 0;
+}
+
+static int
+read_text(Frame *f, FILE *in, bool *eof)
 {
 	char *line;
+	bool start = true;
 	int llen, dlen = strlen(delimeter);
+	size_t len = f->len, nlines = f->nlines;
 
-	len = 0;
+	f->len = f->nlines = 0;
 	for (;;) {
-		if (len + dlen + 2 > cap) {
+		if (f->len + dlen + 2 > f->cap) {
 			/* 
 			 * Buffer must have sufficient capacity to
 			 * store delimeter string, \n and \0 in one read.
 			 */
-			cap = cap ? cap * 2 : INITIAL_CAPACITY;
-			if (!(text = realloc(text, cap))) {
+			f->cap = f->cap ? f->cap * 2 : INITIAL_CAPACITY;
+			if (!(f->text = realloc(f->text, f->cap))) {
 				perror("realloc");
 				return -1;
 			}
 		}
 
-		line = &text[len];
-		if (fgets(line, cap - len, inputf) == NULL) {
-			if (!feof(inputf)) {
+		line = &f->text[f->len];
+		if (fgets(line, f->cap - f->len, in) == NULL) {
+			if (!feof(in)) {
 				perror("fgets");
 				return -1;
 			}
 
-			if (fclose(inputf) == -1) {
-				perror("fclose");
-				return -1;
+			*eof = true;
+			/* Nothing read since the last delimeter, keep that frame */
+			if (!f->nlines) {
+				f->len = len;
+				f->nlines = nlines;
+				return 0;
 			}
-			inputf = NULL;
 			break;
 		}
 
 		llen = strlen(line);
+		if (recordf)
+			record(line, llen);
+		if (replayf)
+			stats.bytes += llen;
+
+		if (start && push_line(f, f->len) < 0)
+			return -1;
 
 		if (line[llen - 1] == '\n') {
 			line[--llen] = '\0';
-			len += llen + 1;
+			f->len += llen + 1;
+			start = true;
 		} else {
-			len += llen;
+			f->len += llen;
+			start = false;
 		}
 
-		if (llen == dlen && strcmp(line, delimeter) == 0) {
-			len -= dlen + 2;
+		if (f->text + f->lines[f->nlines - 1] == line &&
+		    llen == dlen && strcmp(line, delimeter) == 0) {
+			f->len -= dlen + 1;
+			f->nlines--;
 			break;
 		}
 	}
 
+	if (replayf)
+		f->ns = nsecs();
+
+	return 1;
+}
+
+static int
+read_all(FILE *in, void *buf, size_t n)
+{
+	ssize_t r;
+	size_t got = 0;
+
+	while (got < n) {
+		if ((r = read(fileno(in), (char *)buf + got, n - got)) < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("read");
+			return -1;
+		}
+		if (r == 0)
+			break;
+		got += r;
+	}
+
+	if (recordf && got)
+		record(buf, got);
+	if (replayf)
+		stats.bytes += got;
+	return got;
+}
+
+static int
+text_reserve(Frame *f, size_t n)
+{
+	if (n <= f->cap)
+		return 0;
+
+	f->cap = n;
+	if (!(f->text = realloc(f->text, f->cap))) {
+		perror("realloc");
+		return -1;
+	}
 	return 0;
 }
 
+static int parse_frame(Frame *f, uint32_t type, uint32_t n);
+
+static int
+read_frame(Frame *f, FILE *in, bool *eof)
+{
+	uint32_t hdr[2], type, n;
+	int r;
+
+	if ((r = read_all(in, hdr, sizeof(hdr))) < 0)
+		return -1;
+	if (r == 0) {
+		*eof = true;
+		return 0;
+	}
+	if (r != sizeof(hdr)) {
+		fputs("truncated frame header\n", stderr);
+		return -1;
+	}
+
+	type = ntohl(hdr[0]);
+	n = ntohl(hdr[1]);
+	if (n > MAX_FRAME || (type == FrameNoChange && n) || type > FrameNoChange) {
+		fprintf(stderr, "invalid frame type %u length %u\n", type, n);
+		return -1;
+	}
+
+	if (text_reserve(f, n + 1) < 0)
+		return -1;
+
+	if (read_all(in, f->text, n) != (int)n) {
+		fputs("truncated frame\n", stderr);
+		return -1;
+	}
+
+	if (replayf)
+		f->ns = nsecs();
+
+	if (type == FrameNoChange)
+		return 0;
+
+	return parse_frame(f, type, n);
+}
+
+/* Shrink buffers after a run of frames using a fraction of them */
 static void
-render(void)
+frame_trim(Frame *f, bool force)
 {
-	int ty = y + pad;
-	int32_t stride;
-	uint32_t tw = 0, w = 0, h = 0;
-	char *line;
-	PoolBuf *buf;
+	char *text;
+	size_t *lines, n;
 
-	if (width < 0 || height < 0)
+	if (!force && (f->cap <= TRIM_MIN || f->len * 4 >= f->cap)) {
+		f->small = 0;
+		return;
+	}
+	if (!force && ++f->small < TRIM_FRAMES)
 		return;
+	f->small = 0;
 
-	/* Use maximum text line width and height */
-	for (line = text; line < text + len; line += strlen(line) + 1) {
-		tw = drwl_font_getwidth(drw, line);
-		w = MAX(w, tw);
-		h += drw->font->height;
+	n = MAX(f->len * 2, INITIAL_CAPACITY);
+	if (n < f->cap && (text = realloc(f->text, n))) {
+		f->text = text;
+		f->cap = n;
+	}
+
+	n = MAX(f->nlines * 2, INITIAL_CAPACITY);
+	if (n < f->linecap && (lines = realloc(f->lines, n * sizeof(*lines)))) {
+		f->lines = lines;
+		f->linecap = n;
+	}
+}
+
+static int
+read_input(Frame *f, FILE *in, bool *eof)
+{
+	int n;
+
+	*eof = false;
+	n = framed ? read_frame(f, in, eof) : read_text(f, in, eof);
+	if (n > 0)
+		frame_trim(f, false);
+	return n;
+}
+
+/* Build the line table of a text or lines frame already in text */
+static int
+parse_frame(Frame *f, uint32_t type, uint32_t n)
+{
+	uint32_t count, off, table, i;
+	char *p;
+
+	f->text[n] = '\0';
+	f->len = n;
+	f->nlines = 0;
+
+	if (type == FrameText) {
+		for (p = f->text; p < f->text + n; p += strlen(p) + 1)
+			if (push_line(f, p - f->text) < 0)
+				return -1;
+		return 1;
+	}
+
+	/* FrameLines: count and offsets precede the text */
+	if (n < sizeof(count))
+		goto truncated;
+	memcpy(&count, f->text, sizeof(count));
+	count = ntohl(count);
+	if (n < sizeof(count) + (uint64_t)count * sizeof(off))
+		goto truncated;
+	table = sizeof(count) + count * sizeof(off);
+	for (i = 0; i < count; i++) {
+		memcpy(&off, f->text + sizeof(count) + i * sizeof(off), sizeof(off));
+		/* Compared before adding the table size, which could wrap */
+		if ((off = ntohl(off)) > n - table) {
+			fputs("invalid frame line offset\n", stderr);
+			return -1;
+		}
+		if (push_line(f, table + off) < 0)
+			return -1;
+	}
+
+	return 1;
+
+truncated:
+	fputs("truncated frame line table\n", stderr);
+	return -1;
+}
+
+static int
+set_line(Frame *f, uint32_t idx, const char *s, size_t n)
+{
+	char *buf, *p;
+	const char *l;
+	size_t i, ll, size = 0, count = MAX(f->nlines, (size_t)idx + 1);
+
+	n = strnlen(s, n);
+	for (i = 0; i < count; i++)
+		size += (i == idx ? n : i < f->nlines ?
+			strlen(f->text + f->lines[i]) : 0) + 1;
+
+	if (!(buf = malloc(size))) {
+		perror("malloc");
+		return -1;
+	}
+
+	for (p = buf, i = 0; i < count; i++, p += ll + 1) {
+		l = i == idx ? s : i < f->nlines ? f->text + f->lines[i] : "";
+		ll = i == idx ? n : strlen(l);
+		memcpy(p, l, ll);
+		p[ll] = '\0';
+	}
+
+	free(f->text);
+	f->text = buf;
+	f->len = f->cap = size;
+	f->nlines = 0;
+	for (p = f->text; p < f->text + f->len; p += strlen(p) + 1)
+		if (push_line(f, p - f->text) < 0)
+			return -1;
+
+	return 0;
+}
+
+static int
+client_frame(Frame *f, uint32_t type, const char *data, uint32_t n)
+{
+	uint32_t idx;
+
+	switch (type) {
+	case FrameText:
+	case FrameLines:
+		if (text_reserve(f, n + 1) < 0)
+			return -1;
+		memcpy(f->text, data, n);
+		if (parse_frame(f, type, n) < 0) {
+			f->nlines = 0;
+			return -1;
+		}
+		return 1;
+	case FrameNoChange:
+		return n ? -1 : 0;
+	case FrameSetLine:
+		if (n < sizeof(idx))
+			return -1;
+		memcpy(&idx, data, sizeof(idx));
+		idx = ntohl(idx);
+		/* Replace a line or append one, never a run of empty ones */
+		if (idx > f->nlines)
+			return -1;
+		return set_line(f, idx, data + sizeof(idx), n - sizeof(idx)) < 0 ? -1 : 1;
+	default:
+		return -1;
+	}
+}
+
+/*
+ * Pipeline mode: the I/O thread reads frames into the back buffer and
+ * swaps it with the middle one, marking it fresh; run() swaps a fresh
+ * middle buffer with the one it shows. Neither side waits on the other
+ * and frames are never copied, stale ones are simply overwritten.
+ */
+static void
+frame_publish(void)
+{
+	back = atomic_exchange(&middle, back | FRESH) & ~FRESH;
+}
+
+static bool
+frame_acquire(void)
+{
+	if (!(atomic_load(&middle) & FRESH))
+		return false;
+	frame = &frames[atomic_exchange(&middle, frame - frames) & ~FRESH];
+	return true;
+}
+
+static void
+io_notify(unsigned int state)
+{
+	uint64_t one = 1;
+
+	atomic_fetch_or(&io_state, state);
+	if (write(io_fd, &one, sizeof(one)) < 0)
+		perror("eventfd");
+}
+
+static void *
+io_run(void *data)
+{
+	FILE *in;
+	bool eof;
+	int n;
+
+	/* Ends once cleanup() closes the other end of io_ctl */
+	while (read(io_ctl[0], &in, sizeof(in)) == sizeof(in)) {
+		do {
+			if ((n = read_input(&frames[back], in, &eof)) < 0) {
+				io_notify(IoError);
+				break;
+			}
+			if (n > 0)
+				frame_publish();
+			if (eof && close_input(in) < 0)
+				io_notify(IoError);
+			if (n > 0 || eof)
+				io_notify(eof ? IoEof : 0);
+		} while (!eof && !atomic_load(&io_stop));
+
+		if (!eof && atomic_load(&io_stop))
+			close_input(in);
+	}
+
+	return NULL;
+}
+
+static void
+io_shutdown(void)
+{
+	atomic_store(&io_stop, true);
+	close(io_ctl[1]);
+
+	/* A frame being read ends with the output of the command */
+	if (cmdpid > 0 && kill(-cmdpid, SIGTERM) < 0)
+		kill(cmdpid, SIGTERM);
+
+	pthread_join(io_thread, NULL);
+	close(io_fd);
+	close(io_ctl[0]);
+}
+
+static int
+io_setup(void)
+{
+	int err;
+
+	if ((io_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) {
+		perror("eventfd");
+		return -1;
+	}
+	if (pipe2(io_ctl, O_CLOEXEC) < 0) {
+		perror("pipe");
+		goto err;
+	}
+	if ((err = pthread_create(&io_thread, NULL, io_run, NULL))) {
+		fprintf(stderr, "pthread_create: %s\n", strerror(err));
+		close(io_ctl[0]);
+		close(io_ctl[1]);
+		goto err;
+	}
+	return 0;
+
+err:
+	/* No thread for cleanup() to stop */
+	close(io_fd);
+	io_fd = -1;
+	return -1;
+}
+
+/* Returns -1 once the client should be dropped */
+static int
+client_read(Client *c, bool *changed)
+{
+	uint32_t hdr[2], n;
+	size_t off;
+	ssize_t r;
+	int ret;
+
+	if (c->len == c->cap) {
+		if (c->cap >= MAX_FRAME + FRAME_HEADER)
+			return -1;
+		c->cap = c->cap ? c->cap * 2 : 4096;
+		if (!(c->buf = realloc(c->buf, c->cap))) {
+			perror("realloc");
+			return -1;
+		}
+	}
+
+	/* One read per wakeup, a busy client must not starve the others */
+	if ((r = read(c->fd, c->buf + c->len, c->cap - c->len)) < 0)
+		return errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+	if (r == 0)
+		return -1;
+	c->len += r;
+
+	for (off = 0; c->len - off >= FRAME_HEADER; off += FRAME_HEADER + n) {
+		memcpy(hdr, c->buf + off, sizeof(hdr));
+		n = ntohl(hdr[1]);
+		if (n > MAX_FRAME)
+			return -1;
+		if (c->len - off - FRAME_HEADER < n)
+			break;
+		if ((ret = client_frame(frame, ntohl(hdr[0]),
+				c->buf + off + FRAME_HEADER, n)) < 0) {
+			fputs("control: invalid frame\n", stderr);
+			return -1;
+		}
+		*changed |= ret;
+	}
+	memmove(c->buf, c->buf + off, c->len - off);
+	c->len -= off;
+
+	/* Do not keep a buffer grown for a large frame while idle */
+	if (c->len == 0 && c->cap > 4096) {
+		free(c->buf);
+		c->buf = NULL;
+		c->cap = 0;
+	}
+	return 0;
+}
+
+static void
+client_drop(size_t i)
+{
+	close(clients[i].fd);
+	free(clients[i].buf);
+	clients[i] = clients[--nclients];
+}
+
+static void
+client_accept(void)
+{
+	int fd;
+	Client *c;
+
+	while ((fd = accept4(ctl_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+		if (!(c = realloc(clients, (nclients + 1) * sizeof(Client)))) {
+			perror("realloc");
+			close(fd);
+			return;
+		}
+		clients = c;
+		clients[nclients++] = (Client){ .fd = fd };
+	}
+
+	if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+		perror("accept");
+}
+
+/* Remove a socket left behind by an earlier run, nothing else */
+static int
+ctl_stale(struct sockaddr_un *addr)
+{
+	struct stat st;
+	int fd, ret;
+
+	if (lstat(ctl_path, &st) < 0) {
+		if (errno == ENOENT)
+			return 0;
+		perror(ctl_path);
+		return -1;
+	}
+	if (!S_ISSOCK(st.st_mode)) {
+		fprintf(stderr, "%s: exists and is not a socket\n", ctl_path);
+		return -1;
+	}
+
+	if ((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0) {
+		perror("socket");
+		return -1;
+	}
+	ret = connect(fd, (struct sockaddr *)addr, sizeof(*addr));
+	close(fd);
+	if (ret == 0 || errno != ECONNREFUSED) {
+		fprintf(stderr, "%s: in use\n", ctl_path);
+		return -1;
+	}
+
+	if (unlink(ctl_path) < 0) {
+		perror(ctl_path);
+		return -1;
+	}
+	return 0;
+}
+
+static int
+ctl_setup(void)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	int fd;
+
+	if (strlen(ctl_path) >= sizeof(addr.sun_path)) {
+		fputs("control socket path too long\n", stderr);
+		return -1;
+	}
+	strcpy(addr.sun_path, ctl_path);
+
+	if (ctl_stale(&addr) < 0)
+		return -1;
+
+	if ((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0) {
+		perror("socket");
+		return -1;
+	}
+
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		perror(ctl_path);
+		close(fd);
+		return -1;
+	}
+	/* Set only once bound, cleanup() unlinks the path */
+	ctl_fd = fd;
+	if (listen(ctl_fd, SOMAXCONN) < 0) {
+		perror(ctl_path);
+		return -1;
 	}
 
-	w = MIN(w + pad * 2 + x, width);
-	h = MIN(h + pad * 2 + y, height);
-	stride = drwl_stride(w);
+	return 0;
+}
+
+static void
+visibility_changed(void)
+{
+	Widget *wd;
+	bool any = false;
 
-	if (!(buf = poolbuf_create(shm, w, h, stride, 0))) {
-		fputs("failed to create draw buffer\n", stderr);
+	wl_list_for_each(wd, &widgets, link)
+		any |= wd->visible;
+
+	if (any == visible)
+		return;
+	visible = any;
+	if (!visible)
 		return;
+
+	/* Shown again: refresh immediately, a command run once stays done */
+	if (cmdpid == 0 && !inputf) {
+		alarm(0);
+		if (period != 0)
+			restart = true;
+	}
+}
+
+static void
+visibility_update(Widget *wd)
+{
+	bool v = !wd->starved && (wd->noutputs > 0 || !wd->entered);
+
+	if (v != wd->visible) {
+		wd->visible = v;
+		/* Redraw what was missed while hidden */
+		if (wd->visible && wd->dirty)
+			render(wd);
+	}
+
+	visibility_changed();
+}
+
+static void
+check_starved(void)
+{
+	Widget *wd;
+	uint64_t now = nsecs();
+
+	wl_list_for_each(wd, &widgets, link) {
+		if (!wd->frame_callback || wd->starved ||
+		    now - wd->frame_time < FRAME_TIMEOUT * 1000000000ULL)
+			continue;
+		wd->starved = true;
+		visibility_update(wd);
+	}
+}
+
+/* Milliseconds until a pending frame callback counts as starved, or -1 */
+static int
+frame_timeout(void)
+{
+	Widget *wd;
+	uint64_t now = nsecs(), due;
+	int ms, timeout = -1;
+
+	wl_list_for_each(wd, &widgets, link) {
+		if (!wd->frame_callback || wd->starved)
+			continue;
+		due = wd->frame_time + FRAME_TIMEOUT * 1000000000ULL;
+		ms = due > now ? (due - now + 999999) / 1000000 : 0;
+		if (timeout < 0 || ms < timeout)
+			timeout = ms;
+	}
+
+	return timeout;
+}
+
+static void
+frame_done(void *data, struct wl_callback *callback, uint32_t time)
+{
+	Widget *wd = data;
+
+	wl_callback_destroy(callback);
+	wd->frame_callback = NULL;
+	wd->starved = false;
+	visibility_update(wd);
+}
+
+static const struct wl_callback_listener frame_listener = {
+	.done = frame_done,
+};
+
+static void
+widget_size(Widget *wd, uint32_t tw, uint32_t th, uint32_t *w, uint32_t *h)
+{
+	*w = MIN(tw + pad * 2 + x, (uint32_t)wd->width);
+	*h = MIN(th + pad * 2 + y, (uint32_t)wd->height);
+}
+
+static void
+widget_commit(Widget *wd, PoolBuf *buf, uint32_t w, uint32_t h)
+{
+	/* Keep the oldest pending callback, it measures starvation */
+	if (!wd->frame_callback) {
+		wd->frame_callback = wl_surface_frame(wd->surface);
+		wl_callback_add_listener(wd->frame_callback, &frame_listener, wd);
+		wd->frame_time = nsecs();
+	}
+
+	wl_surface_attach(wd->surface, buf->wl_buf, 0, 0);
+	wl_surface_damage_buffer(wd->surface, 0, 0, w, h);
+	wl_surface_commit(wd->surface);
+}
+
+static void widget_setup(Widget *wd);
+
+/* Draw the frame on one widget, or on all of them when only is NULL */
+static void
+render(Widget *only)
+{
+	static unsigned int serial;
+	int ty;
+	int32_t stride;
+	uint32_t tw = 0, th = 0, w, h, ow, oh;
+	size_t i;
+	PoolBuf *buf;
+	Widget *wd, *o;
+
+	/* Use maximum text line width and height */
+	for (i = 0; i < frame->nlines; i++) {
+		w = drwl_font_getwidth(drw, frame->text + frame->lines[i]);
+		tw = MAX(tw, w);
+		th += drw->font->height;
 	}
 
-	drwl_prepare_drawing(drw, w, h, buf->data, buf->stride);
+	serial++;
+	wl_list_for_each(wd, &widgets, link) {
+		/* Closed by the compositor while its output remained */
+		if (!only && !wd->surface)
+			widget_setup(wd);
+		if ((only && wd != only) || !wd->configured || wd->drawn == serial)
+			continue;
+		if (!wd->visible) {
+			wd->dirty = true;
+			continue;
+		}
 
-	drwl_rect(drw, x, y, w, h, 1, 1);
+		widget_size(wd, tw, th, &w, &h);
+		stride = drwl_stride(w);
+
+		if (!(buf = poolbuf_create(shm, w, h, stride, 0))) {
+			fputs("failed to create draw buffer\n", stderr);
+			return;
+		}
 
-	for (line = text; line < text + len; line += strlen(line) + 1) {
-		drwl_text(drw, x + pad, ty, w - pad * 2, drw->font->height, 0, line, 0);
-		ty += drw->font->height;
+		drwl_prepare_drawing(drw, w, h, buf->data, buf->stride);
+
+		drwl_rect(drw, x, y, w, h, 1, 1);
+
+		ty = y + pad;
+		for (i = 0; i < frame->nlines; i++) {
+			drwl_text(drw, x + pad, ty, w - pad * 2, drw->font->height, 0,
+				frame->text + frame->lines[i], 0);
+			ty += drw->font->height;
+		}
+
+		drwl_finish_drawing(drw);
+
+		/* Widgets of the same size share the rendered buffer */
+		for (o = wd; &o->link != &widgets;
+		     o = wl_container_of(o->link.next, o, link)) {
+			if ((only && o != only) || !o->configured ||
+			    !o->visible || o->drawn == serial)
+				continue;
+			widget_size(o, tw, th, &ow, &oh);
+			if (ow != w || oh != h)
+				continue;
+			o->drawn = serial;
+			o->dirty = false;
+			widget_commit(o, buf, w, h);
+		}
 	}
+}
 
-	drwl_finish_drawing(drw);
+static void
+surface_enter(void *data, struct wl_surface *surface, struct wl_output *output)
+{
+	Widget *wd = data;
 
-	wl_surface_attach(surface, buf->wl_buf, 0, 0);
-	wl_surface_damage_buffer(surface, 0, 0, w, h);
-	wl_surface_commit(surface);
+	wd->entered = true;
+	wd->noutputs++;
+	visibility_update(wd);
 }
 
+static void
+surface_leave(void *data, struct wl_surface *surface, struct wl_output *output)
+{
+	Widget *wd = data;
+
+	wd->noutputs--;
+	visibility_update(wd);
+}
+
+static const struct wl_surface_listener surface_listener = {
+	.enter = surface_enter,
+	.leave = surface_leave,
+};
+
 static void
 layer_surface_configure(void *data, struct zwlr_layer_surface_v1 *surface,
                         uint32_t serial, uint32_t w, uint32_t h)
 {
-	width = w;
-	height = h;
+	Widget *wd = data;
+
+	wd->width = w;
+	wd->height = h;
+	wd->configured = true;
 	zwlr_layer_surface_v1_ack_configure(surface, serial);
+
+	if (frame->text)
+		render(wd);
 }
 
+static void widget_teardown(Widget *wd);
+
 static void
 layer_surface_closed(void *data, struct zwlr_layer_surface_v1 *layer_surface)
 {
-	running = false;
+	/*
+	 * With -a the output may still be there, the widget is set up
+	 * again on the next frame; it is destroyed along with the output.
+	 */
+	if (all_outputs) {
+		widget_teardown(data);
+		visibility_changed();
+	} else
+		running = false;
 }
 
 static const struct zwlr_layer_surface_v1_listener layer_surface_listener = {
@@ -217,22 +1227,128 @@ static const struct zwlr_layer_surface_v1_listener layer_surface_listener = {
     .closed = &layer_surface_closed,
 };
 
+static Widget *
+widget_create(struct wl_output *output, uint32_t name)
+{
+	Widget *wd;
+
+	if (!(wd = calloc(1, sizeof(Widget)))) {
+		perror("calloc");
+		return NULL;
+	}
+
+	wd->output = output;
+	wd->name = name;
+	wd->visible = true;
+	wl_list_insert(widgets.prev, &wd->link);
+	return wd;
+}
+
+static void
+widget_setup(Widget *wd)
+{
+	wd->surface = wl_compositor_create_surface(compositor);
+	wl_surface_add_listener(wd->surface, &surface_listener, wd);
+	wd->layer_surface = zwlr_layer_shell_v1_get_layer_surface(layer_shell,
+		wd->surface, wd->output, ZWLR_LAYER_SHELL_V1_LAYER_BOTTOM, "wtw");
+	zwlr_layer_surface_v1_add_listener(wd->layer_surface,
+		&layer_surface_listener, wd);
+    zwlr_layer_surface_v1_set_exclusive_zone(wd->layer_surface, -1);
+	zwlr_layer_surface_v1_set_size(wd->layer_surface, width, height);
+	zwlr_layer_surface_v1_set_anchor(wd->layer_surface,
+		ZWLR_LAYER_SURFACE_V1_ANCHOR_TOP | ZWLR_LAYER_SURFACE_V1_ANCHOR_LEFT |
+		((width && height) ? 0 :
+		ZWLR_LAYER_SURFACE_V1_ANCHOR_RIGHT | ZWLR_LAYER_SURFACE_V1_ANCHOR_BOTTOM));
+	wl_surface_commit(wd->surface);
+}
+
+static void
+widget_teardown(Widget *wd)
+{
+	if (wd->frame_callback)
+		wl_callback_destroy(wd->frame_callback);
+	if (wd->layer_surface)
+		zwlr_layer_surface_v1_destroy(wd->layer_surface);
+	if (wd->surface)
+		wl_surface_destroy(wd->surface);
+	wd->frame_callback = NULL;
+	wd->layer_surface = NULL;
+	wd->surface = NULL;
+	wd->configured = wd->entered = wd->starved = wd->dirty = false;
+	wd->noutputs = 0;
+	wd->visible = true;
+}
+
+static void
+widget_destroy(Widget *wd)
+{
+	widget_teardown(wd);
+	if (wd->output)
+		wl_output_destroy(wd->output);
+	wl_list_remove(&wd->link);
+	free(wd);
+	visibility_changed();
+}
+
 static void
 registry_global(void *data, struct wl_registry *wl_registry,
 		uint32_t name, const char *interface, uint32_t version)
 {
+	Widget *wd;
+	Output *o;
+
 	if (!strcmp(interface, wl_shm_interface.name))
 		shm = wl_registry_bind(registry, name, &wl_shm_interface, 1);
 	else if (!strcmp(interface, wl_compositor_interface.name))
 		compositor = wl_registry_bind(registry, name, &wl_compositor_interface, 4);
 	else if (!strcmp(interface, zwlr_layer_shell_v1_interface.name))
 		layer_shell = wl_registry_bind(wl_registry, name, &zwlr_layer_shell_v1_interface, 2);
+	else if (all_outputs && !strcmp(interface, wl_output_interface.name)) {
+		if (!(wd = widget_create(wl_registry_bind(wl_registry, name,
+				&wl_output_interface, 1), name)))
+			return;
+		/* Outputs announced later are set up right away */
+		if (drw)
+			widget_setup(wd);
+		visibility_changed();
+	} else if (!strcmp(interface, wl_output_interface.name)) {
+		if (!(o = calloc(1, sizeof(Output)))) {
+			perror("calloc");
+			return;
+		}
+		o->output = wl_registry_bind(wl_registry, name, &wl_output_interface, 1);
+		o->name = name;
+		wl_list_insert(&outputs, &o->link);
+	}
+}
+
+static void
+output_destroy(Output *o)
+{
+	wl_output_destroy(o->output);
+	wl_list_remove(&o->link);
+	free(o);
 }
 
 static void
 registry_global_remove(void *data,
 		struct wl_registry *wl_registry, uint32_t name)
 {
+	Widget *wd;
+	Output *o;
+
+	wl_list_for_each(wd, &widgets, link) {
+		if (wd->name == name) {
+			widget_destroy(wd);
+			return;
+		}
+	}
+	wl_list_for_each(o, &outputs, link) {
+		if (o->name == name) {
+			output_destroy(o);
+			return;
+		}
+	}
 }
 
 static const struct wl_registry_listener registry_listener = {
@@ -244,11 +1360,14 @@ static int
 setup(void)
 {
 	sigset_t mask;
+	Widget *wd;
 
 	if (!(display = wl_display_connect(NULL))) {
 		fprintf(stderr, "could not connect to display\n");
 		return -1;
 	}
+	wl_list_init(&widgets);
+	wl_list_init(&outputs);
 
 	registry = wl_display_get_registry(display);
 	wl_registry_add_listener(registry, &registry_listener, NULL);
@@ -264,6 +1383,7 @@ setup(void)
 	sigaddset(&mask, SIGTERM);
 	sigaddset(&mask, SIGALRM);
 	sigaddset(&mask, SIGCHLD);
+	sigaddset(&mask, SIGUSR1);
 
 	if (sigprocmask(SIG_BLOCK, &mask, NULL) < 0) {
 		perror("sigprocmask");
@@ -284,32 +1404,72 @@ setup(void)
 		return -1;
 	drwl_setscheme(drw, scheme);
 
-	surface = wl_compositor_create_surface(compositor);
-	layer_surface = zwlr_layer_shell_v1_get_layer_surface(layer_shell, surface,
-		NULL, ZWLR_LAYER_SHELL_V1_LAYER_BOTTOM, "wtw");
-	zwlr_layer_surface_v1_add_listener(layer_surface,
-		&layer_surface_listener, NULL);
-    zwlr_layer_surface_v1_set_exclusive_zone(layer_surface, -1);
-	zwlr_layer_surface_v1_set_size(layer_surface, width, height);
-	zwlr_layer_surface_v1_set_anchor(layer_surface,
-		ZWLR_LAYER_SURFACE_V1_ANCHOR_TOP | ZWLR_LAYER_SURFACE_V1_ANCHOR_LEFT |
-		((width && height) ? 0 :
-		ZWLR_LAYER_SURFACE_V1_ANCHOR_RIGHT | ZWLR_LAYER_SURFACE_V1_ANCHOR_BOTTOM));
-	wl_surface_commit(surface);
+	if (ctl_path && ctl_setup() < 0)
+		return -1;
+
+	if (pipelined && io_setup() < 0)
+		return -1;
+
+	if (!all_outputs && !widget_create(NULL, 0))
+		return -1;
+	wl_list_for_each(wd, &widgets, link)
+		widget_setup(wd);
+	visibility_changed();
 
 	return 0;
 }
 
+/* Release what the shown frame does not need once over the memory budget */
+static int
+check_memory(void)
+{
+	uint64_t now = nsecs();
+	long kib;
+	Fnt *font;
+
+	if (now - mem_checked < 1000000000)
+		return 0;
+	mem_checked = now;
+
+	/*
+	 * RSS includes libraries and shm buffers, a budget below that is
+	 * never met: trim again only once RSS grew past what the last left.
+	 */
+	if ((kib = rss()) < 0 || kib <= mem_budget ||
+	    kib <= mem_trimmed + mem_trimmed / 16)
+		return 0;
+
+	/* fcft only frees its glyphs along with the font */
+	font = drw->font;
+	drwl_setfont(drw, NULL);
+	drwl_font_destroy(font);
+	if (!drwl_font_create(drw, 1, &font_name, NULL))
+		return -1;
+
+	/* The shown frame is the only one owned here in pipeline mode */
+	frame_trim(frame, true);
+#ifdef __GLIBC__
+	malloc_trim(0);
+#endif
+
+	/* Rasterize the glyphs of the shown frame again */
+	if (frame->text)
+		render(NULL);
+	mem_trimmed = rss();
+	return 0;
+}
+
 static int
 run(void)
 {
+	int n;
+	size_t i;
+	uint64_t count;
+	unsigned int state;
+	bool changed, eof;
+	struct pollfd *p;
 	struct signalfd_siginfo si;
-	struct pollfd fds[3] = {
-		{ .fd = wl_display_get_fd(display), .events = POLLIN },
-		{ .fd = signal_fd,                  .events = POLLIN },
-		{ .fd = -1,                         .events = POLLIN },
-	};
-	
+
 	restart = running = true;
 	while (running) {
 		if (wl_display_prepare_read(display) < 0) {
@@ -321,47 +1481,113 @@ run(void)
 
 		wl_display_flush(display);
 
-		if (restart && cmdpid == 0 && !inputf) {
+		if (restart && (cmd[0] || replayf) && cmdpid == 0 && !inputf) {
 			restart = false;
-			start_cmd();
+			if (replayf)
+				stats.start = nsecs();
+			if (start_cmd() == 0 && pipelined &&
+			    write(io_ctl[1], &inputf, sizeof(inputf)) != sizeof(inputf)) {
+				perror("write");
+				return EXIT_FAILURE;
+			}
 		}
 
-		fds[2].fd = inputf ? fileno(inputf) : -1;
-
-		if (poll(fds, 3, -1) < 0) {
+		/* Display, signals, command, control socket, then its clients */
+		if (!(p = realloc(pollfds, (4 + nclients) * sizeof(*pollfds)))) {
+			perror("realloc");
+			return EXIT_FAILURE;
+		}
+		pollfds = p;
+		pollfds[0] = (struct pollfd){ .fd = wl_display_get_fd(display), .events = POLLIN };
+		pollfds[1] = (struct pollfd){ .fd = signal_fd, .events = POLLIN };
+		pollfds[2] = (struct pollfd){ .fd = pipelined ? io_fd :
+			inputf ? fileno(inputf) : -1, .events = POLLIN };
+		pollfds[3] = (struct pollfd){ .fd = ctl_fd, .events = POLLIN };
+		for (i = 0; i < nclients; i++)
+			pollfds[4 + i] = (struct pollfd){ .fd = clients[i].fd, .events = POLLIN };
+
+		/* Wake up to notice frame callbacks that never arrive */
+		if (poll(pollfds, 4 + nclients, frame_timeout()) < 0) {
 			perror("poll");
 			return EXIT_FAILURE;
 		}
 
-		if (fds[1].revents & POLLIN) {
+		check_starved();
+
+		if (pollfds[1].revents & POLLIN) {
 			ssize_t n = read(signal_fd, &si, sizeof(si));
 			if (n != sizeof(si))
 				perror("signalfd");
 			if (si.ssi_signo == SIGCHLD) {
 				reap();
-				if (period < 0)
+				if (!visible) {
+					if (hidden_period > 0 && period != 0)
+						alarm(hidden_period);
+				} else if (cur_period < 0)
 					restart = true;
 				else if (!restart)
-					alarm(period);
-			} else if (si.ssi_signo == SIGALRM && cmdpid == 0)
-				restart = true;
+					alarm(cur_period);
+			} else if (si.ssi_signo == SIGALRM) {
+				if (cmdpid == 0 && (visible || hidden_period > 0))
+					restart = true;
+			} else if (si.ssi_signo == SIGUSR1)
+				print_stats();
 			else
 				return EXIT_FAILURE;
 		}
 
 		/* Command error */
-		if (fds[2].revents & POLLHUP) {
+		if (pollfds[2].revents & (POLLERR | POLLNVAL)) {
 			inputf = NULL;
 			return EXIT_FAILURE;
 		}
 
-		if (inputf && fds[2].revents & POLLIN) {
-			if (read_text() < 0)
+		if (pipelined && pollfds[2].revents & POLLIN) {
+			if (read(io_fd, &count, sizeof(count)) < 0)
+				perror("eventfd");
+			if ((state = atomic_exchange(&io_state, 0)) & IoError)
 				return EXIT_FAILURE;
-			render();
+			if (frame_acquire()) {
+				render(NULL);
+				if (replayf)
+					replay_frame();
+			}
+			if (state & IoEof)
+				inputf = NULL;
+		} else if (inputf && pollfds[2].revents & (POLLIN | POLLHUP)) {
+			/* Output left by an exited command is read up to its end */
+			if ((n = read_input(frame, inputf, &eof)) < 0)
+				return EXIT_FAILURE;
+			if (eof) {
+				if (close_input(inputf) < 0)
+					return EXIT_FAILURE;
+				inputf = NULL;
+			}
+			if (n > 0) {
+				render(NULL);
+				if (replayf)
+					replay_frame();
+			}
 		}
 
-		if (!(fds[0].revents & POLLIN)) {
+		/* Backwards, as dropping moves the last client into its slot */
+		changed = false;
+		for (i = nclients; i-- > 0;)
+			if (pollfds[4 + i].revents && client_read(&clients[i], &changed) < 0)
+				client_drop(i);
+		if (pollfds[3].revents & POLLIN)
+			client_accept();
+		if (changed)
+			render(NULL);
+
+		/* Replay is over once its writer exited and input drained */
+		if (replayf && stats.start && cmdpid == 0 && !inputf)
+			running = false;
+
+		if (mem_budget > 0 && check_memory() < 0)
+			return EXIT_FAILURE;
+
+		if (!(pollfds[0].revents & POLLIN)) {
 			wl_display_cancel_read(display);
 			continue;
 		}
@@ -383,18 +1609,41 @@ run(void)
 static void
 cleanup(void)
 {
+	Widget *wd, *tmp;
+	Output *o, *otmp;
+	int i;
+
+	/* The I/O thread records and reads frames until it is stopped */
+	if (io_fd >= 0)
+		io_shutdown();
+	if (recordf)
+		fclose(recordf);
+	if (replayf)
+		fclose(replayf);
 	if (!display)
 		return;
 	if (signal_fd > 0)
 		close(signal_fd);
+	while (nclients)
+		client_drop(nclients - 1);
+	free(clients);
+	free(pollfds);
+	if (ctl_fd >= 0) {
+		close(ctl_fd);
+		unlink(ctl_path);
+	}
+	wl_list_for_each_safe(wd, tmp, &widgets, link)
+		widget_destroy(wd);
+	wl_list_for_each_safe(o, otmp, &outputs, link)
+		output_destroy(o);
+	for (i = 0; i < 3; i++) {
+		free(frames[i].text);
+		free(frames[i].lines);
+	}
 	if (drw)
 		drwl_destroy(drw);
-	if (layer_surface)
-		zwlr_layer_surface_v1_destroy(layer_surface);
 	if (layer_shell)
 		zwlr_layer_shell_v1_destroy(layer_shell);
-	if (surface)
-		wl_surface_destroy(surface);
 	if (compositor)
 		wl_compositor_destroy(compositor);
 	if (shm)
@@ -410,15 +1659,39 @@ main(int argc, char *argv[])
 	int opt;
 	int ret = EXIT_FAILURE;
 
-	while ((opt = getopt(argc, argv, "b:c:f:p:P:vw:h:x:y:")) != -1) {
+	/* Character widths for the monospace layout */
+	setlocale(LC_CTYPE, "");
+
+	while ((opt = getopt(argc, argv, "ab:Bc:C:f:Fm:p:P:r:R:s:S:tvw:h:x:y:")) != -1) {
 		switch (opt) {
+		case 'a': all_outputs = true; break;
 		case 'b':
 		case 'c':
 			scheme[opt == 'b' ? ColBg : ColFg] = strtoul(optarg, NULL, 16);
 			break;
+		case 'B': framed = true; break;
+		case 'C': cpu_budget = atoi(optarg); break;
+		case 'm': mem_budget = atoi(optarg); break;
 		case 'f': font_name = optarg; break;
+		case 'F': replay_fast = true; break;
 		case 'p': period = atoi(optarg); break;
 		case 'P': pad = atoi(optarg); break;
+		case 'r':
+			if (!(recordf = fopen(optarg, "w")) ||
+			    fwrite(trace_magic, sizeof(trace_magic), 1, recordf) != 1) {
+				perror(optarg);
+				return ret;
+			}
+			break;
+		case 'R':
+			if (!(replayf = fopen(optarg, "r"))) {
+				perror(optarg);
+				return ret;
+			}
+			break;
+		case 's': hidden_period = atoi(optarg); break;
+		case 'S': ctl_path = optarg; break;
+		case 't': pipelined = true; break;
 		case 'v': puts("wtw " VERSION); return EXIT_SUCCESS;
 		case 'w': width = atoi(optarg); break;
 		case 'h': height = atoi(optarg); break;
@@ -431,17 +1704,20 @@ main(int argc, char *argv[])
 	}
 	argv += optind;
 	argc -= optind;
-	if (argc < 1) {
+	if (argc < 1 && !replayf && !ctl_path) {
 		fprintf(stderr, usage);
 		return ret;
 	}
 
 	cmd = argv;
+	cur_period = period;
 
 	if (setup() < 0)
 		goto err;
 
 	ret = run();
+	if (replayf && ret == EXIT_SUCCESS)
+		replay_report();
 err:
 	cleanup();
 	return ret;
@@ -0,0 +1,117 @@
+/* See LICENSE file for copyright and license details. */
+#define _POSIX_C_SOURCE 200809L
+#include <arpa/inet.h>
+#include <errno.h>
+#include <getopt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "frame.h"
+
+static const char usage[] =
+	"usage: wtwctl [-l line] socket < text\n";
+
+static int
+write_all(int fd, const void *buf, size_t n)
+{
+	ssize_t r;
+
+	while (n > 0) {
+		if ((r = write(fd, buf, n)) < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		buf = (const char *)buf + r;
+		n -= r;
+	}
+
+	return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+	int opt, fd;
+	long line = -1;
+	char *text = NULL, *p;
+	size_t len = 0, cap = 0, n;
+	uint32_t hdr[3];
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+
+	while ((opt = getopt(argc, argv, "l:v")) != -1) {
+		switch (opt) {
+		case 'l': line = atol(optarg); break;
+		case 'v': puts("wtwctl " VERSION); return EXIT_SUCCESS;
+		default:
+			fprintf(stderr, usage);
+			return EXIT_FAILURE;
+		}
+	}
+	if (argc - optind != 1 || line >= MAX_FRAME) {
+		fprintf(stderr, usage);
+		return EXIT_FAILURE;
+	}
+
+	/* Read all of stdin, one extra byte for a final NUL */
+	do {
+		if (len + 1 >= cap) {
+			cap = cap ? cap * 2 : BUFSIZ;
+			if (!(text = realloc(text, cap))) {
+				perror("realloc");
+				return EXIT_FAILURE;
+			}
+		}
+		len += n = fread(text + len, 1, cap - len - 1, stdin);
+	} while (n > 0);
+	if (ferror(stdin)) {
+		perror("fread");
+		return EXIT_FAILURE;
+	}
+
+	/* Lines are sent NUL-terminated */
+	if (len > 0 && text[len - 1] != '\n')
+		text[len++] = '\n';
+	for (p = text; (p = memchr(p, '\n', text + len - p)); p++)
+		*p = '\0';
+	if (line >= 0)
+		len = len ? strlen(text) + 1 : 0;
+
+	if (len + sizeof(uint32_t) > MAX_FRAME) {
+		fputs("text too large\n", stderr);
+		return EXIT_FAILURE;
+	}
+
+	if (strlen(argv[optind]) >= sizeof(addr.sun_path)) {
+		fputs("socket path too long\n", stderr);
+		return EXIT_FAILURE;
+	}
+	strcpy(addr.sun_path, argv[optind]);
+
+	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+		perror("socket");
+		return EXIT_FAILURE;
+	}
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		perror(argv[optind]);
+		return EXIT_FAILURE;
+	}
+
+	hdr[0] = htonl(line >= 0 ? FrameSetLine : FrameText);
+	hdr[1] = htonl(len + (line >= 0 ? sizeof(uint32_t) : 0));
+	hdr[2] = htonl(line);
+	if (write_all(fd, hdr, line >= 0 ? sizeof(hdr) : FRAME_HEADER) < 0 ||
+	    write_all(fd, text, len) < 0) {
+		perror("write");
+		return EXIT_FAILURE;
+	}
+
+	close(fd);
+	free(text);
+	return EXIT_SUCCESS;
+}